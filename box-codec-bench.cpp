@@ -0,0 +1,86 @@
+#include "box-codec.h"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+using namespace cv;
+using namespace std;
+
+// The parser loadImage() used before the codecs, kept for comparison
+size_t legacyParse(const string& text, vector<Box>& boxes) {
+    istringstream boxifs(text);
+    string box;
+    size_t rejected = 0;
+    while (getline(boxifs, box)) {
+        stringstream ss(box);
+        vector<string> elems;
+        string item, buf;
+        while (getline(ss, item, '\t')) {
+            elems.push_back(item);
+            if (buf.length() > 0) {
+                buf.append("::");
+            }
+            buf.append(item);
+        }
+        if (elems.size() < 4) {
+            rejected++;
+        } else {
+            Rect rect(stoi(elems.at(0)), stoi(elems.at(1)),
+                      stoi(elems.at(2)), stoi(elems.at(3)));
+            string content;
+            if (elems.size() >= 5) {
+                content = elems.at(4);
+            }
+            boxes.push_back(Box(rect, content));
+        }
+    }
+    return rejected;
+}
+
+template<typename Parse>
+void run(const string& name, const string& text, size_t count, int rounds, Parse parse) {
+    vector<Box> boxes;
+    boxes.reserve(count);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        boxes.clear();
+        parse(text, boxes);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    if (boxes.size() != count) {
+        cout << name << ": parsed " << boxes.size() << " of " << count << " boxes [FAIL]" << endl;
+        return;
+    }
+    cout << name << ": " << (size_t)(count * rounds / elapsed.count()) << " boxes/s" << endl;
+}
+
+template<typename Format>
+void runCodec(const string& name, const vector<Box>& boxes, int rounds) {
+    string text;
+    BoxCodec<Format>::write(boxes, text);
+    run(name, text, boxes.size(), rounds, [](const string& t, vector<Box>& b) {
+        BoxCodec<Format>::parse(t.data(), t.data() + t.size(), b);
+    });
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc >= 2 ? stoul(argv[1]) : 100000;
+    int rounds = argc >= 3 ? stoi(argv[2]) : 20;
+
+    vector<Box> boxes;
+    for (size_t i = 0; i < count; i++) {
+        Rect rect(i % 5000, i % 3000, 10 + i % 200, 10 + i % 100);
+        boxes.push_back(Box(rect, i % 3 == 0 ? "" : "label" + to_string(i % 1000)));
+    }
+
+    string text;
+    BoxCodec<TsvFormat>::write(boxes, text);
+    run("legacy", text, count, rounds, legacyParse);
+    runCodec<TsvFormat>("tsv", boxes, rounds);
+    runCodec<BinaryFormat>("binary", boxes, rounds);
+    runCodec<JsonFormat>("json", boxes, rounds);
+
+    return 0;
+}
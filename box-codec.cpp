@@ -0,0 +1,395 @@
+#include "box-codec.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace cv;
+using namespace std;
+
+static void appendInt(string& out, int value) {
+    char buf[16];
+    to_chars_result r = to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, r.ptr);
+}
+
+const char* BoxCodec<TsvFormat>::extension() {
+    return ".box";
+}
+
+size_t BoxCodec<TsvFormat>::parse(const char* first, const char* last, vector<Box>& boxes) {
+    size_t rejected = 0;
+    const char* p = first;
+    while (p < last) {
+        const char* eol = (const char*)memchr(p, '\n', last - p);
+        if (!eol) {
+            eol = last;
+        }
+        const char* end = eol;
+        if (end > p && end[-1] == '\r') {
+            --end;
+        }
+
+        // x, y and width must be followed by a tab, height by a tab or the end
+        int v[4];
+        const char* q = p;
+        bool ok = true;
+        for (int i = 0; i < 4 && ok; i++) {
+            from_chars_result r = from_chars(q, end, v[i]);
+            if (r.ec != errc() || (r.ptr == end ? i < 3 : *r.ptr != '\t')) {
+                ok = false;
+            } else {
+                q = r.ptr == end ? end : r.ptr + 1;
+            }
+        }
+
+        if (ok) {
+            const char* tab = (const char*)memchr(q, '\t', end - q);
+            boxes.emplace_back(Rect(v[0], v[1], v[2], v[3]), string(q, tab ? tab : end));
+        } else {
+            rejected++;
+        }
+        p = eol + 1;
+    }
+    return rejected;
+}
+
+void BoxCodec<TsvFormat>::write(const vector<Box>& boxes, string& out) {
+    for (vector<Box>::const_iterator it = boxes.begin(); it != boxes.end(); it++) {
+        appendInt(out, it->rect.x);
+        out += '\t';
+        appendInt(out, it->rect.y);
+        out += '\t';
+        appendInt(out, it->rect.width);
+        out += '\t';
+        appendInt(out, it->rect.height);
+        out += '\t';
+        out += it->content;
+        out += '\n';
+    }
+}
+
+static const char BINARY_MAGIC[4] = { 'B', 'O', 'X', 'B' };
+
+const char* BoxCodec<BinaryFormat>::extension() {
+    return ".boxb";
+}
+
+size_t BoxCodec<BinaryFormat>::parse(const char* first, const char* last, vector<Box>& boxes) {
+    uint32_t count = 0;
+    if (last - first < 8 || memcmp(first, BINARY_MAGIC, 4) != 0) {
+        return 1;
+    }
+    memcpy(&count, first + 4, 4);
+
+    const char* p = first + 8;
+    for (uint32_t i = 0; i < count; i++) {
+        int32_t v[4];
+        uint32_t len;
+        // Truncated, the count cannot be trusted to say how much is missing
+        if (last - p < 20) {
+            return 1;
+        }
+        memcpy(v, p, 16);
+        memcpy(&len, p + 16, 4);
+        p += 20;
+        if ((size_t)(last - p) < len) {
+            return 1;
+        }
+        boxes.emplace_back(Rect(v[0], v[1], v[2], v[3]), string(p, len));
+        p += len;
+    }
+    return 0;
+}
+
+void BoxCodec<BinaryFormat>::write(const vector<Box>& boxes, string& out) {
+    uint32_t count = boxes.size();
+    out.append(BINARY_MAGIC, 4);
+    out.append((const char*)&count, 4);
+    for (vector<Box>::const_iterator it = boxes.begin(); it != boxes.end(); it++) {
+        int32_t v[4] = { it->rect.x, it->rect.y, it->rect.width, it->rect.height };
+        uint32_t len = it->content.size();
+        out.append((const char*)v, 16);
+        out.append((const char*)&len, 4);
+        out += it->content;
+    }
+}
+
+const char* BoxCodec<JsonFormat>::extension() {
+    return ".box.json";
+}
+
+static const char* skipSpace(const char* p, const char* last) {
+    while (p < last && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static void appendUtf8(string& out, unsigned int cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xc0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += (char)(0xe0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    } else {
+        out += (char)(0xf0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3f));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    }
+}
+
+static bool parseHex4(const char* p, const char* last, unsigned int& value) {
+    return last - p >= 4 && from_chars(p, p + 4, value, 16).ptr == p + 4;
+}
+
+// Parses a JSON string starting at the opening quote, returns NULL on error
+static const char* parseString(const char* p, const char* last, string& out) {
+    if (p >= last || *p != '"') {
+        return NULL;
+    }
+    for (p++; p < last; p++) {
+        if (*p == '"') {
+            return p + 1;
+        }
+        if (*p != '\\') {
+            out += *p;
+            continue;
+        }
+        if (++p >= last) {
+            return NULL;
+        }
+        switch (*p) {
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            unsigned int cp = 0;
+            if (!parseHex4(p + 1, last, cp)) {
+                return NULL;
+            }
+            p += 4;
+            // Characters past the BMP come as a high and a low surrogate
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                unsigned int low = 0;
+                if (last - p < 3 || p[1] != '\\' || p[2] != 'u' || !parseHex4(p + 3, last, low) ||
+                    low < 0xdc00 || low > 0xdfff) {
+                    return NULL;
+                }
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                p += 6;
+            } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                return NULL;
+            }
+            appendUtf8(out, cp);
+            break;
+        }
+        default: out += *p; break;
+        }
+    }
+    return NULL;
+}
+
+// Parses one box object, returns NULL on error
+static const char* parseBox(const char* p, const char* last, Box& box) {
+    if (p >= last || *p != '{') {
+        return NULL;
+    }
+    p = skipSpace(p + 1, last);
+    if (p < last && *p == '}') {
+        return p + 1;
+    }
+    while (p < last) {
+        string key;
+        p = parseString(p, last, key);
+        if (!p) {
+            return NULL;
+        }
+        p = skipSpace(p, last);
+        if (p >= last || *p != ':') {
+            return NULL;
+        }
+        p = skipSpace(p + 1, last);
+
+        if (key == "content") {
+            box.content.clear();
+            p = parseString(p, last, box.content);
+            if (!p) {
+                return NULL;
+            }
+        } else {
+            int value = 0;
+            from_chars_result r = from_chars(p, last, value);
+            if (r.ec != errc()) {
+                return NULL;
+            }
+            p = r.ptr;
+            if (key == "x") {
+                box.rect.x = value;
+            } else if (key == "y") {
+                box.rect.y = value;
+            } else if (key == "width") {
+                box.rect.width = value;
+            } else if (key == "height") {
+                box.rect.height = value;
+            }
+        }
+
+        p = skipSpace(p, last);
+        if (p < last && *p == '}') {
+            return p + 1;
+        }
+        if (p >= last || *p != ',') {
+            return NULL;
+        }
+        p = skipSpace(p + 1, last);
+    }
+    return NULL;
+}
+
+size_t BoxCodec<JsonFormat>::parse(const char* first, const char* last, vector<Box>& boxes) {
+    const char* p = skipSpace(first, last);
+    if (p >= last || *p != '[') {
+        return 1;
+    }
+    p = skipSpace(p + 1, last);
+    if (p < last && *p == ']') {
+        return 0;
+    }
+    while (p < last) {
+        Box box;
+        p = parseBox(p, last, box);
+        if (!p) {
+            // Give up on the rest, there is no reliable way to resync
+            return 1;
+        }
+        boxes.push_back(box);
+
+        p = skipSpace(p, last);
+        if (p < last && *p == ']') {
+            return 0;
+        }
+        if (p >= last || *p != ',') {
+            return 1;
+        }
+        p = skipSpace(p + 1, last);
+    }
+    return 1;
+}
+
+void BoxCodec<JsonFormat>::write(const vector<Box>& boxes, string& out) {
+    out += '[';
+    for (vector<Box>::const_iterator it = boxes.begin(); it != boxes.end(); it++) {
+        out += it == boxes.begin() ? "\n" : ",\n";
+        out += "  {\"x\": ";
+        appendInt(out, it->rect.x);
+        out += ", \"y\": ";
+        appendInt(out, it->rect.y);
+        out += ", \"width\": ";
+        appendInt(out, it->rect.width);
+        out += ", \"height\": ";
+        appendInt(out, it->rect.height);
+        out += ", \"content\": \"";
+        for (string::const_iterator c = it->content.begin(); c != it->content.end(); c++) {
+            if (*c == '"' || *c == '\\') {
+                out += '\\';
+                out += *c;
+            } else if (*c == '\n') {
+                out += "\\n";
+            } else if (*c == '\t') {
+                out += "\\t";
+            } else if ((unsigned char)*c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)*c);
+                out += buf;
+            } else {
+                out += *c;
+            }
+        }
+        out += "\"}";
+    }
+    out += "\n]\n";
+}
+
+bool parseBoxFormat(const string& name, BoxFormat& format) {
+    if (name == "tsv") {
+        format = BOX_FORMAT_TSV;
+    } else if (name == "binary") {
+        format = BOX_FORMAT_BINARY;
+    } else if (name == "json") {
+        format = BOX_FORMAT_JSON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* boxFileExtension(BoxFormat format) {
+    switch (format) {
+    case BOX_FORMAT_BINARY:
+        return BoxCodec<BinaryFormat>::extension();
+    case BOX_FORMAT_JSON:
+        return BoxCodec<JsonFormat>::extension();
+    default:
+        return BoxCodec<TsvFormat>::extension();
+    }
+}
+
+bool readFile(const string& path, string& buf) {
+    // Directories open fine as a stream but have no sensible size
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    ifstream ifs(path, ios::in | ios::binary);
+    if (!ifs.is_open()) {
+        return false;
+    }
+    buf.resize(st.st_size);
+    ifs.read(&buf[0], buf.size());
+    buf.resize(ifs.gcount());
+    return !ifs.bad();
+}
+
+bool readBoxFile(const string& path, BoxFormat format, vector<Box>& boxes, size_t* rejected) {
+    switch (format) {
+    case BOX_FORMAT_BINARY:
+        return readBoxFile<BinaryFormat>(path, boxes, rejected);
+    case BOX_FORMAT_JSON:
+        return readBoxFile<JsonFormat>(path, boxes, rejected);
+    default:
+        return readBoxFile<TsvFormat>(path, boxes, rejected);
+    }
+}
+
+bool writeBoxFile(const string& path, BoxFormat format, const vector<Box>& boxes) {
+    string buf;
+    switch (format) {
+    case BOX_FORMAT_BINARY:
+        BoxCodec<BinaryFormat>::write(boxes, buf);
+        break;
+    case BOX_FORMAT_JSON:
+        BoxCodec<JsonFormat>::write(boxes, buf);
+        break;
+    default:
+        BoxCodec<TsvFormat>::write(boxes, buf);
+        break;
+    }
+
+    ofstream ofs(path, ios::out | ios::binary);
+    if (!ofs.is_open()) {
+        return false;
+    }
+    ofs.write(buf.data(), buf.size());
+    return ofs.good();
+}
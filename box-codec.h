@@ -0,0 +1,81 @@
+#ifndef BOX_CODEC_H
+#define BOX_CODEC_H
+
+#include "box.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Box file formats, used as tags to select a BoxCodec at compile time.
+struct TsvFormat {};
+struct BinaryFormat {};
+struct JsonFormat {};
+
+// Every codec provides:
+//   extension()  file name suffix, including the dot
+//   parse()      appends the boxes in [first, last) to boxes and returns
+//                the number of malformed records that were skipped
+//   write()      appends the encoded boxes to out
+template<typename Format> class BoxCodec;
+
+// One box per line: x, y, width, height and content separated by tabs.
+template<> class BoxCodec<TsvFormat> {
+public:
+    static const char* extension();
+    static size_t parse(const char* first, const char* last, std::vector<Box>& boxes);
+    static void write(const std::vector<Box>& boxes, std::string& out);
+};
+
+// "BOXB", a uint32 count, then per box int32 x, y, width, height, a
+// uint32 content length and the content bytes. All in host byte order.
+template<> class BoxCodec<BinaryFormat> {
+public:
+    static const char* extension();
+    static size_t parse(const char* first, const char* last, std::vector<Box>& boxes);
+    static void write(const std::vector<Box>& boxes, std::string& out);
+};
+
+// An array of {"x", "y", "width", "height", "content"} objects.
+template<> class BoxCodec<JsonFormat> {
+public:
+    static const char* extension();
+    static size_t parse(const char* first, const char* last, std::vector<Box>& boxes);
+    static void write(const std::vector<Box>& boxes, std::string& out);
+};
+
+enum BoxFormat {
+    BOX_FORMAT_TSV,
+    BOX_FORMAT_BINARY,
+    BOX_FORMAT_JSON
+};
+
+// The format used when none is given on the command line
+#ifndef BOX_FORMAT_DEFAULT
+#define BOX_FORMAT_DEFAULT BOX_FORMAT_TSV
+#endif
+
+// Accepts "tsv", "binary" or "json".
+bool parseBoxFormat(const std::string& name, BoxFormat& format);
+const char* boxFileExtension(BoxFormat format);
+
+bool readFile(const std::string& path, std::string& buf);
+
+template<typename Format>
+bool readBoxFile(const std::string& path, std::vector<Box>& boxes, size_t* rejected = NULL) {
+    std::string buf;
+    if (!readFile(path, buf)) {
+        return false;
+    }
+    size_t n = BoxCodec<Format>::parse(buf.data(), buf.data() + buf.size(), boxes);
+    if (rejected) {
+        *rejected = n;
+    }
+    return true;
+}
+
+// Returns false if the file cannot be opened.
+bool readBoxFile(const std::string& path, BoxFormat format, std::vector<Box>& boxes,
+                 size_t* rejected = NULL);
+bool writeBoxFile(const std::string& path, BoxFormat format, const std::vector<Box>& boxes);
+
+#endif
@@ -1,38 +1,38 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include "box-codec.h"
+#include "image-source.h"
+#include "migrate.h"
+#include "path.h"
+#include "text-renderer.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <libgen.h>
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 
-#if defined(_WIN32) || defined(__CYGWIN__)
-#define PATH_SEPARATOR '\\'
-#else
-#define PATH_SEPARATOR '/'
-#endif
-
 #define MODE_VIEW 1
 #define MODE_EDIT 2
 
 using namespace cv;
 using namespace std;
 
-class Box {
-public:
-    Box();
-    Box(const Rect& r);
-    Box(const Rect& r, const string& ct);
-
-    Rect rect;
-    string content;
-};
+Ptr<ImageSource> img;
+Mat display;
+Rect viewRect;
+
+// What is under the text in display, and what was drawn there. Text-only
+// changes restore the old text bands from scene instead of redrawing it.
+Mat scene;
+vector<Box> sceneBoxes;
+vector<Rect> textBands;
+ImageSource* sceneImage = NULL;
+Rect sceneView;
+int sceneSelected = -1;
+int sceneBorderMask = 0;
+int sceneShowBorderMask = 0;
 
-inline Box::Box(): rect(Rect(0, 0, 0, 0)) {}
-inline Box::Box(const Rect& r): rect(r) {}
-inline Box::Box(const Rect& r, const string& ct): rect(r), content(ct) {}
-
-Mat img, display;
 Point pt1(0, 0);
 Point pt2(0, 0);
 Rect selectRect(0, 0, 0, 0);
@@ -42,6 +42,7 @@ string displayWindowName = "ImageDisplay";
 string imageListPath;
 string workDir;
 string boxDir;
+BoxFormat boxFormat = BOX_FORMAT_DEFAULT;
 
 bool imageLoaded = false;
 bool clicked = false;
@@ -54,6 +55,11 @@ int editPos;
 int borderMask;
 int showBorderMask;
 
+// Tiled images are shown through a window of at most this size
+int maxViewWidth = 1600;
+int maxViewHeight = 1000;
+size_t tileCacheBytes = 512 << 20;
+
 vector<string> images;
 vector<Box> boxes;
 
@@ -79,12 +85,12 @@ int makedirs(const char * path, mode_t mode) {
     return 0;
 }
 
-void drawImage(Mat &display, Box* selected=NULL, int borderMask = 0, int mode = 0,
-               string text="", int textPos = -1, double fontScale = 1) {
-    display = img.clone();
+void drawScene(Mat &display, const Rect& roi, Box* selected=NULL, int borderMask = 0) {
+    img->read(roi, display);
+    Point offset = roi.tl();
 
     for (vector<Box>::iterator it = boxes.begin(); it != boxes.end(); it++) {
-        if (it->rect.width > 0 && it->rect.height > 0) {
+        if (it->rect.width > 0 && it->rect.height > 0 && (it->rect & roi).area() > 0) {
             Scalar color;
             int thickness = 1;
             if (&(*it) == selected) {
@@ -97,12 +103,12 @@ void drawImage(Mat &display, Box* selected=NULL, int borderMask = 0, int mode =
             } else {
                 color = Scalar(0, 255, 0);
             }
-            rectangle(display, it->rect, color, thickness, 8, 0);
+            rectangle(display, it->rect - offset, color, thickness, 8, 0);
         }
     }
 
     if (selected && borderMask > 0) {
-        Rect rect = selected->rect;
+        Rect rect = selected->rect - offset;
         Scalar color = Scalar(255, 0, 255);
         int thickness = 1;
         if (!selected->content.empty()) {
@@ -124,11 +130,14 @@ void drawImage(Mat &display, Box* selected=NULL, int borderMask = 0, int mode =
             line(display, Point(rect.x, rect.y), Point(rect.x, rect.y + rect.height - 1), color, thickness);
         }
     }
+}
 
+void drawText(Mat &display, int mode = 0, string text="", int textPos = -1, double fontScale = 1,
+              vector<Rect>* bands = NULL) {
     if (!text.empty()) {
         int baseline = 0;
-        int fontFace = CV_FONT_HERSHEY_DUPLEX;
         int thickness = 2;
+        TextRenderer& renderer = TextRenderer::get(CV_FONT_HERSHEY_DUPLEX, fontScale, thickness);
 
         string formerText, latterText;
         bool showPos = false;
@@ -140,11 +149,10 @@ void drawImage(Mat &display, Box* selected=NULL, int borderMask = 0, int mode =
             formerText = text;
         }
 
-        Size formerTextSize = getTextSize(formerText, fontFace, fontScale,
-                                          thickness, &baseline);
-        Size latterTextSize = getTextSize(latterText, fontFace, fontScale,
-                                          thickness, &baseline);
-        int x = 0, y = (display.rows + max(formerTextSize.height, latterTextSize.height))/2;
+        Size formerTextSize = renderer.measure(formerText, &baseline);
+        Size latterTextSize = renderer.measure(latterText, &baseline);
+        int height = max(formerTextSize.height, latterTextSize.height);
+        int x = 0, y = (display.rows + height)/2;
         int width = formerTextSize.width + latterTextSize.width;
         if (formerTextSize.width > display.cols) {
             x = display.cols - formerTextSize.width;
@@ -162,15 +170,19 @@ void drawImage(Mat &display, Box* selected=NULL, int borderMask = 0, int mode =
              Scalar(0, 0, 255));
 
         // text
-        putText(display, formerText, textOrg, fontFace, fontScale,
-                Scalar(0, 255, 0), thickness, 8);
+        Rect band = renderer.draw(display, formerText, textOrg, Scalar(0, 255, 0));
         if (showPos) {
             line(display, Point(x + formerTextSize.width, y),
-                 Point(x + formerTextSize.width, y - max(formerTextSize.height, latterTextSize.height)),
+                 Point(x + formerTextSize.width, y - height),
                  Scalar(0, 0, 255), 1);
         }
-        putText(display, latterText, textOrg + Point(formerTextSize.width, 0),
-                fontFace, fontScale, Scalar(0, 255, 0), thickness, 8);
+        band |= renderer.draw(display, latterText, textOrg + Point(formerTextSize.width, 0),
+                              Scalar(0, 255, 0));
+        if (bands) {
+            // The text may be shifted anywhere along the row, take the full width
+            int top = min(band.y, y - height), bottom = max(band.y + band.height, y + thickness + 1);
+            bands->push_back(Rect(0, top, display.cols, bottom - top) & Rect(0, 0, display.cols, display.rows));
+        }
     }
 
     if (mode == MODE_VIEW || mode == MODE_EDIT) {
@@ -179,26 +191,68 @@ void drawImage(Mat &display, Box* selected=NULL, int borderMask = 0, int mode =
             modeText = "EDIT";
         }
 
-        int baseline = 0;
-        int fontFace = CV_FONT_HERSHEY_SIMPLEX;
-        double fontScale = 1;
         Scalar color = Scalar(0, 255, 0);
-        int thickness = 2;
+        TextRenderer& renderer = TextRenderer::get(CV_FONT_HERSHEY_SIMPLEX, 1, 2);
 
-        Size textSize = getTextSize(modeText, fontFace, fontScale,
-                                    thickness, &baseline);
-        putText(display, "No." + to_string(curImageIdx), Point(10, textSize.height + 5),
-                fontFace, fontScale, color, thickness, 8);
-        putText(display, modeText, Point(display.cols - textSize.width - 10, textSize.height + 5),
-                fontFace, fontScale, color, thickness, 8);
+        Size textSize = renderer.measure(modeText);
+        Rect band = renderer.draw(display, "No." + to_string(curImageIdx), Point(10, textSize.height + 5), color);
+        band |= renderer.draw(display, modeText, Point(display.cols - textSize.width - 10, textSize.height + 5), color);
+        if (bands) {
+            bands->push_back(band);
+        }
     }
 }
 
+void drawImage(Mat &display, const Rect& roi, Box* selected=NULL, int borderMask = 0, int mode = 0,
+               string text="", int textPos = -1, double fontScale = 1) {
+    drawScene(display, roi, selected, borderMask);
+    drawText(display, mode, text, textPos, fontScale);
+}
+
+bool sameBoxes(const vector<Box>& a, const vector<Box>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].rect != b[i].rect || a[i].content != b[i].content) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void showImage(string text="", int textPos = -1, double fontScale = 1) {
-    drawImage(display, selected, borderMask, mode, text, textPos, fontScale);
+    int selectedIdx = selected ? selected - &boxes[0] : -1;
+    if (scene.empty() || sceneImage != (ImageSource*)img || sceneView != viewRect ||
+        sceneSelected != selectedIdx || sceneBorderMask != borderMask ||
+        sceneShowBorderMask != showBorderMask || !sameBoxes(sceneBoxes, boxes)) {
+        drawScene(scene, viewRect, selected, borderMask);
+        scene.copyTo(display);
+        sceneImage = img;
+        sceneView = viewRect;
+        sceneSelected = selectedIdx;
+        sceneBorderMask = borderMask;
+        sceneShowBorderMask = showBorderMask;
+        sceneBoxes = boxes;
+    } else {
+        // Only the text changed, put back what was under the old text
+        for (vector<Rect>::iterator it = textBands.begin(); it != textBands.end(); it++) {
+            scene(*it).copyTo(display(*it));
+        }
+    }
+
+    textBands.clear();
+    drawText(display, mode, text, textPos, fontScale, &textBands);
     imshow(displayWindowName, display);
 }
 
+void moveView(int x, int y) {
+    Size size = img->size();
+    viewRect.x = min(max(0, viewRect.x + x * viewRect.width / 2), size.width - viewRect.width);
+    viewRect.y = min(max(0, viewRect.y + y * viewRect.height / 2), size.height - viewRect.height);
+    showImage();
+}
+
 void changeUnitSize(int value) {
     unitSize = max(1, unitSize + value);
     showImage(to_string(unitSize), -1, 2);
@@ -206,8 +260,9 @@ void changeUnitSize(int value) {
 
 void move(int x, int y) {
     if (selected && selected->rect.width > 0 && selected->rect.height > 0) {
-        selected->rect.x = min(max(0, selected->rect.x + unitSize * x), img.cols - selected->rect.width);
-        selected->rect.y = min(max(0, selected->rect.y + unitSize * y), img.rows - selected->rect.height);
+        Size size = img->size();
+        selected->rect.x = min(max(0, selected->rect.x + unitSize * x), size.width - selected->rect.width);
+        selected->rect.y = min(max(0, selected->rect.y + unitSize * y), size.height - selected->rect.height);
         showImage();
     }
 }
@@ -215,10 +270,10 @@ void move(int x, int y) {
 void changeSize(int x, int y) {
     if (selected && selected->rect.width > 0 && selected->rect.height > 0) {
         if (selected->rect.width + x * unitSize > 0) {
-            selected->rect.width = min(selected->rect.width + x * unitSize, img.cols - selected->rect.x);
+            selected->rect.width = min(selected->rect.width + x * unitSize, img->size().width - selected->rect.x);
         }
         if (selected->rect.height + y * unitSize > 0) {
-            selected->rect.height = min(selected->rect.height + y * unitSize, img.rows - selected->rect.y);
+            selected->rect.height = min(selected->rect.height + y * unitSize, img->size().height - selected->rect.y);
         }
         showImage();
     }
@@ -253,7 +308,35 @@ void leaveEditMode(bool save) {
     showImage();
 }
 
-bool loadImage(int idx, Mat& img) {
+Ptr<ImageSource> openImage(const string& path) {
+    // A pre-split tile pyramid next to the image takes precedence
+    TileDirImageSource* tileDir = new TileDirImageSource(path + ".tiles", tileCacheBytes);
+    if (tileDir->open()) {
+        return Ptr<ImageSource>(tileDir);
+    }
+    delete tileDir;
+
+#ifdef HAVE_LIBTIFF
+    string::size_type extPos = path.rfind('.');
+    string ext = extPos == string::npos ? "" : path.substr(extPos);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == ".tif" || ext == ".tiff") {
+        TiffImageSource* tiff = new TiffImageSource(path, tileCacheBytes);
+        if (tiff->open()) {
+            return Ptr<ImageSource>(tiff);
+        }
+        delete tiff;
+    }
+#endif
+
+    Mat mat = imread(path);
+    if (mat.empty()) {
+        return Ptr<ImageSource>();
+    }
+    return Ptr<ImageSource>(new MatImageSource(mat));
+}
+
+bool loadImage(int idx) {
     if (idx < 0 || idx >= images.size()) {
         return false;
     }
@@ -261,7 +344,7 @@ bool loadImage(int idx, Mat& img) {
     cout << "Loading the image '" << name << "' ";
 
     // Read image from file
-    Mat newimg = imread(workDir + PATH_SEPARATOR + name);
+    Ptr<ImageSource> newimg = openImage(workDir + PATH_SEPARATOR + name);
     imageLoaded = false;
 
     // If fail to read the image
@@ -278,52 +361,47 @@ bool loadImage(int idx, Mat& img) {
     imageLoaded = true;
 
     img = newimg;
+    Size size = img->size();
+    if (img->tiled()) {
+        viewRect = Rect(0, 0, min(size.width, maxViewWidth), min(size.height, maxViewHeight));
+    } else {
+        viewRect = Rect(0, 0, size.width, size.height);
+    }
     string boxfile = boxDir + PATH_SEPARATOR + name + "_" +
-        to_string(newimg.cols) + "x" + to_string(newimg.rows) + ".box";
+        to_string(size.width) + "x" + to_string(size.height) + boxFileExtension(boxFormat);
 
-    ifstream boxifs(boxfile);
-    if (boxifs.is_open()) {
+    size_t rejected = 0;
+    if (readBoxFile(boxfile, boxFormat, boxes, &rejected)) {
         cout << "Loading the box of image '" << boxfile << "'..." << endl;
-        string box;
-        while (getline(boxifs, box)) {
-            stringstream ss(box);
-            vector<string> elems;
-            string item, buf;
-            while (getline(ss, item, '\t')) {
-                elems.push_back(item);
-                if (buf.length() > 0) {
-                    buf.append("::");
-                }
-                buf.append(item);
-            }
-            cout << "    " << buf;
-            if (elems.size() < 4) {
-                cout << " [FAIL]" << endl;
-            } else {
-                Rect rect(stoi(elems.at(0)), stoi(elems.at(1)),
-                          stoi(elems.at(2)), stoi(elems.at(3)));
-                string content;
-                if (elems.size() >= 5) {
-                    content = elems.at(4);
-                }
-                boxes.push_back(Box(rect, content));
-                cout << " [DONE]" << endl;
+        for (vector<Box>::iterator it = boxes.begin(); it != boxes.end(); it++) {
+            cout << "    " << it->rect.x << "::" << it->rect.y << "::";
+            cout << it->rect.width << "::" << it->rect.height;
+            if (!it->content.empty()) {
+                cout << "::" << it->content;
             }
-
+            cout << " [DONE]" << endl;
+        }
+        if (rejected > 0) {
+            cout << "    " << rejected << " malformed [FAIL]" << endl;
         }
     }
 
     return true;
 }
 
+bool tooSmall(const Box& box) {
+    return box.rect.width <= 1 || box.rect.height <= 1;
+}
+
 bool saveImage() {
     if (!imageLoaded) {
         return false;
     }
 
     string name = images.at(curImageIdx);
+    Size size = img->size();
     string boxfile = boxDir + PATH_SEPARATOR  + name + "_" +
-        to_string(img.cols) + "x" + to_string(img.rows) + ".box";
+        to_string(size.width) + "x" + to_string(size.height) + boxFileExtension(boxFormat);
     cout << "Saving the box of image '" << boxfile << "' ";
     if (name.rfind(PATH_SEPARATOR) != std::string::npos) {
         if (makedirs(boxfile.substr(0, boxfile.rfind(PATH_SEPARATOR)).c_str(), 0755) != 0) {
@@ -332,18 +410,14 @@ bool saveImage() {
         }
     }
 
-    ofstream boxofs(boxfile);
-    if (boxofs.is_open()) {
-        for (vector<Box>::iterator it = boxes.begin(); it != boxes.end(); it++) {
-            if (it->rect.width > 1 && it->rect.height > 1) {
-                boxofs << it->rect.x << '\t' << it->rect.y << '\t';
-                boxofs << it->rect.width << '\t' << it->rect.height << '\t';
-                boxofs << it->content << '\n';
-            } else {
-                boxes.erase(it);
-            }
-        }
-        boxofs.close();
+    // Drop the boxes too small to be saved
+    vector<Box>::iterator last = remove_if(boxes.begin(), boxes.end(), tooSmall);
+    if (last != boxes.end()) {
+        boxes.erase(last, boxes.end());
+        selected = NULL;
+    }
+
+    if (writeBoxFile(boxfile, boxFormat, boxes)) {
         cout << "[DONE]" << endl;
         return true;
     } else {
@@ -358,12 +432,25 @@ bool exportImage() {
     }
 
     string name = images.at(curImageIdx);
+    Size size = img->size();
     string imagefile = boxDir + PATH_SEPARATOR  + name + "_" +
-        to_string(img.cols) + "x" + to_string(img.rows) + ".jpg";
+        to_string(size.width) + "x" + to_string(size.height);
+
+    // A tiled image may not fit in memory, or in a JPEG, export the view only
+    Rect roi(0, 0, size.width, size.height);
+    if (img->tiled()) {
+        roi = viewRect;
+        imagefile += "_" + to_string(roi.x) + "_" + to_string(roi.y);
+    }
+    imagefile += ".jpg";
+
     cout << "Exporting the image with boxes '" << imagefile << "' ";
     Mat output;
-    drawImage(output);
-    imwrite(imagefile, output);
+    drawImage(output, roi);
+    if (!imwrite(imagefile, output)) {
+        cout << "[FAIL]" << endl;
+        return false;
+    }
     cout << "[DONE]" << endl;
     return true;
 }
@@ -372,7 +459,7 @@ bool nextImage() {
     saveImage();
     while (curImageIdx + 1 < images.size()) {
         ++curImageIdx;
-        if (loadImage(curImageIdx, img)) {
+        if (loadImage(curImageIdx)) {
             showImage(images.at(curImageIdx));
             return true;
         }
@@ -384,7 +471,7 @@ bool previousImage() {
     saveImage();
     while (curImageIdx > 0) {
         --curImageIdx;
-        if (loadImage(curImageIdx, img)) {
+        if (loadImage(curImageIdx)) {
             showImage(images.at(curImageIdx));
             return true;
         }
@@ -400,6 +487,11 @@ void help() {
     cout << "------> Press 'j' to move right" << endl;
     cout << "------> Press 'l' to move left" << endl << endl;
 
+    cout << "------> Press 'w' to scroll the view up" << endl;
+    cout << "------> Press 's' to scroll the view down" << endl;
+    cout << "------> Press 'a' to scroll the view left" << endl;
+    cout << "------> Press 'd' to scroll the view right" << endl << endl;
+
     cout << "------> Press '^' to grow box height by 1 unit" << endl;
     cout << "------> Press '_' to shrink box height by 1 unit" << endl;
     cout << "------> Press '>' to grow box width by 1 unit" << endl;
@@ -471,6 +563,18 @@ void handleViewModeKey(int key) {
     case (int)'l':
         move(1, 0);
         break;
+    case (int)'w':
+        moveView(0, -1);
+        break;
+    case (int)'s':
+        moveView(0, 1);
+        break;
+    case (int)'a':
+        moveView(-1, 0);
+        break;
+    case (int)'d':
+        moveView(1, 0);
+        break;
     case (int)'>':
         changeSize(1, 0);
         break;
@@ -586,6 +690,10 @@ void onMouse(int event, int x, int y, int flags, void* userdata) {
         return;
     }
 
+    // Work in full-resolution coordinates
+    x += viewRect.x;
+    y += viewRect.y;
+
     if (clicked) {
         pt2.x = x;
         pt2.y = y;
@@ -662,8 +770,20 @@ void onMouse(int event, int x, int y, int flags, void* userdata) {
 }
 
 int main(int argc, char** argv) {
+    // --migrate rescales box files saved for an older image size and exits
+    bool migrate = argc >= 2 && string(argv[1]) == "--migrate";
+    if (migrate) {
+        argc--;
+        argv++;
+    }
+
     if (argc < 2) {
-        cerr << "Usage: box-label image_list" << endl;
+        cerr << "Usage: box-label [--migrate] image_list [tsv|binary|json]" << endl;
+        return -1;
+    }
+
+    if (argc >= 3 && !parseBoxFormat(argv[2], boxFormat)) {
+        cerr << "Unknown box format '" << argv[2] << "'" << endl;
         return -1;
     }
 
@@ -700,6 +820,10 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    if (migrate) {
+        return migrateBoxes(images, workDir, boxDir, boxFormat) == 0 ? 0 : -1;
+    }
+
     help();
 
     // Create a window
@@ -0,0 +1,21 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include <opencv2/core/core.hpp>
+#include <string>
+
+class Box {
+public:
+    Box();
+    Box(const cv::Rect& r);
+    Box(const cv::Rect& r, const std::string& ct);
+
+    cv::Rect rect;
+    std::string content;
+};
+
+inline Box::Box(): rect(cv::Rect(0, 0, 0, 0)) {}
+inline Box::Box(const cv::Rect& r): rect(r) {}
+inline Box::Box(const cv::Rect& r, const std::string& ct): rect(r), content(ct) {}
+
+#endif
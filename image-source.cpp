@@ -0,0 +1,303 @@
+#include "image-source.h"
+#include "path.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+MatImageSource::MatImageSource(const Mat& m): mat(m) {}
+
+Size MatImageSource::size() const {
+    return mat.size();
+}
+
+void MatImageSource::read(const Rect& roi, Mat& out) {
+    Rect r = roi & Rect(0, 0, mat.cols, mat.rows);
+    mat(r).copyTo(out);
+}
+
+TileCache::TileCache(size_t budget): budget(budget), used(0) {}
+
+const Mat* TileCache::get(int tx, int ty) {
+    long long key = ((long long)ty << 32) | (unsigned int)tx;
+    unordered_map<long long, list<Entry>::iterator>::iterator it = index.find(key);
+    if (it == index.end()) {
+        return NULL;
+    }
+    // Move to the front, most recently used
+    lru.splice(lru.begin(), lru, it->second);
+    return &it->second->second;
+}
+
+const Mat& TileCache::put(int tx, int ty, const Mat& tile) {
+    long long key = ((long long)ty << 32) | (unsigned int)tx;
+    lru.push_front(Entry(key, tile));
+    index[key] = lru.begin();
+    used += tile.total() * tile.elemSize();
+    evict();
+    return lru.front().second;
+}
+
+void TileCache::evict() {
+    // Always keep the newest tile, even if it alone exceeds the budget
+    while (used > budget && lru.size() > 1) {
+        const Entry& last = lru.back();
+        used -= last.second.total() * last.second.elemSize();
+        index.erase(last.first);
+        lru.pop_back();
+    }
+}
+
+TiledImageSource::TiledImageSource(size_t cacheBudget): cache(cacheBudget) {}
+
+Size TiledImageSource::size() const {
+    return imageSize;
+}
+
+void TiledImageSource::read(const Rect& roi, Mat& out) {
+    Rect r = roi & Rect(0, 0, imageSize.width, imageSize.height);
+    out.create(r.height, r.width, CV_8UC3);
+    out.setTo(Scalar(0, 0, 0));
+    if (r.area() == 0) {
+        return;
+    }
+
+    int tx0 = r.x / tileSize.width, tx1 = (r.x + r.width - 1) / tileSize.width;
+    int ty0 = r.y / tileSize.height, ty1 = (r.y + r.height - 1) / tileSize.height;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            const Mat* tile = cache.get(tx, ty);
+            if (!tile) {
+                Mat decoded;
+                if (!loadTile(tx, ty, decoded)) {
+                    continue;
+                }
+                tile = &cache.put(tx, ty, decoded);
+            }
+
+            Rect tileRect(tx * tileSize.width, ty * tileSize.height, tile->cols, tile->rows);
+            Rect overlap = tileRect & r;
+            if (overlap.area() == 0) {
+                continue;
+            }
+            (*tile)(overlap - tileRect.tl()).copyTo(out(overlap - r.tl()));
+        }
+    }
+}
+
+TileDirImageSource::TileDirImageSource(const string& dir, size_t cacheBudget):
+    TiledImageSource(cacheBudget), dir(dir) {}
+
+bool TileDirImageSource::open() {
+    ifstream info(dir + PATH_SEPARATOR + "tiles.txt");
+    if (!info.is_open()) {
+        return false;
+    }
+    info >> imageSize.width >> imageSize.height;
+    info >> tileSize.width >> tileSize.height >> extension;
+    // Not area(), which overflows int for slides past 46341 x 46341
+    return !info.fail() && imageSize.width > 0 && imageSize.height > 0 &&
+        tileSize.width > 0 && tileSize.height > 0;
+}
+
+bool TileDirImageSource::loadTile(int tx, int ty, Mat& tile) {
+    string tilefile = dir + PATH_SEPARATOR + "0" + PATH_SEPARATOR +
+        to_string(ty) + "_" + to_string(tx) + "." + extension;
+    tile = imread(tilefile);
+    return !tile.empty();
+}
+
+#ifdef HAVE_LIBTIFF
+TiffImageSource::TiffImageSource(const string& path, size_t cacheBudget):
+    TiledImageSource(cacheBudget), path(path), tif(NULL) {}
+
+TiffImageSource::~TiffImageSource() {
+    if (tif) {
+        TIFFClose(tif);
+    }
+}
+
+bool TiffImageSource::open() {
+    tif = TIFFOpen(path.c_str(), "r");
+    if (!tif) {
+        return false;
+    }
+    if (!TIFFIsTiled(tif)) {
+        return false;
+    }
+
+    uint32_t width = 0, height = 0, tileWidth = 0, tileHeight = 0;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+    TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tileWidth);
+    TIFFGetField(tif, TIFFTAG_TILELENGTH, &tileHeight);
+    imageSize = Size(width, height);
+    tileSize = Size(tileWidth, tileHeight);
+    return imageSize.width > 0 && imageSize.height > 0 &&
+        tileSize.width > 0 && tileSize.height > 0;
+}
+
+bool TiffImageSource::loadTile(int tx, int ty, Mat& tile) {
+    // ABGR packed, with the origin at the lower left of the full tile
+    Mat raster(tileSize.height, tileSize.width, CV_8UC4);
+    if (!TIFFReadRGBATile(tif, tx * tileSize.width, ty * tileSize.height,
+                          (uint32_t*)raster.data)) {
+        return false;
+    }
+    flip(raster, raster, 0);
+
+    int width = min(tileSize.width, imageSize.width - tx * tileSize.width);
+    int height = min(tileSize.height, imageSize.height - ty * tileSize.height);
+    cvtColor(raster(Rect(0, 0, width, height)), tile, CV_RGBA2BGR);
+    return true;
+}
+#endif
+
+static unsigned int bigEndian16(const unsigned char* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static unsigned int bigEndian32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static unsigned int littleEndian16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int littleEndian32u(const unsigned char* p) {
+    return (unsigned int)p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static int littleEndian32(const unsigned char* p) {
+    return (int)littleEndian32u(p);
+}
+
+// Orientation tag of the Exif APP1 payload, 1 (upright) if there is none
+static int readExifOrientation(const unsigned char* p, size_t n) {
+    if (n < 14 || memcmp(p, "Exif\0\0", 6) != 0) {
+        return 1;
+    }
+    const unsigned char* tiff = p + 6;
+    n -= 6;
+    bool bigEndian = tiff[0] == 'M';
+    unsigned int (*read16)(const unsigned char*) = bigEndian ? bigEndian16 : littleEndian16;
+    unsigned int (*read32)(const unsigned char*) = bigEndian ? bigEndian32 : littleEndian32u;
+
+    size_t ifd = read32(tiff + 4);
+    if (ifd + 2 > n) {
+        return 1;
+    }
+    unsigned int count = read16(tiff + ifd);
+    for (unsigned int i = 0; i < count && ifd + 2 + (i + 1) * 12 <= n; i++) {
+        const unsigned char* entry = tiff + ifd + 2 + i * 12;
+        if (read16(entry) == 0x0112) {
+            return read16(entry + 8);
+        }
+    }
+    return 1;
+}
+
+static bool readJpegSize(ifstream& ifs, Size& size) {
+    unsigned char buf[7];
+    int orientation = 1;
+    ifs.seekg(2);
+    while (ifs.read((char*)buf, 2)) {
+        if (buf[0] != 0xff) {
+            return false;
+        }
+        int marker = buf[1];
+        if (marker == 0xff) {
+            // Fill byte, the marker follows
+            ifs.seekg(-1, ios::cur);
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd9)) {
+            continue;
+        }
+        if (!ifs.read((char*)buf, 2)) {
+            return false;
+        }
+        unsigned int length = bigEndian16(buf);
+        if (length < 2) {
+            return false;
+        }
+        // Start of frame, except DHT, JPG and DAC
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            if (!ifs.read((char*)buf, 5)) {
+                return false;
+            }
+            size = Size(bigEndian16(buf + 3), bigEndian16(buf + 1));
+            // imread() applies the Exif orientation, 5 to 8 turn the image by 90 degrees
+            if (orientation >= 5 && orientation <= 8) {
+                size = Size(size.height, size.width);
+            }
+            return true;
+        }
+        if (marker == 0xe1) {
+            vector<unsigned char> app1(length - 2);
+            if (!ifs.read((char*)app1.data(), app1.size())) {
+                return false;
+            }
+            if (orientation == 1) {
+                orientation = readExifOrientation(app1.data(), app1.size());
+            }
+            continue;
+        }
+        ifs.seekg(length - 2, ios::cur);
+    }
+    return false;
+}
+
+bool readImageSize(const string& path, Size& size) {
+    TileDirImageSource tileDir(path + ".tiles", 0);
+    if (tileDir.open()) {
+        size = tileDir.size();
+        return true;
+    }
+
+    ifstream ifs(path, ios::in | ios::binary);
+    unsigned char buf[26];
+    if (!ifs.read((char*)buf, sizeof(buf))) {
+        return false;
+    }
+
+    if (memcmp(buf, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(buf + 12, "IHDR", 4) == 0) {
+        size = Size(bigEndian32(buf + 16), bigEndian32(buf + 20));
+        return true;
+    }
+    if (buf[0] == 0xff && buf[1] == 0xd8) {
+        return readJpegSize(ifs, size);
+    }
+    if (buf[0] == 'B' && buf[1] == 'M') {
+        size = Size(littleEndian32(buf + 18), abs(littleEndian32(buf + 22)));
+        return true;
+    }
+
+#ifdef HAVE_LIBTIFF
+    // Classic TIFF or BigTIFF, which large slides usually are
+    if (memcmp(buf, "II*\0", 4) == 0 || memcmp(buf, "MM\0*", 4) == 0 ||
+        memcmp(buf, "II+\0", 4) == 0 || memcmp(buf, "MM\0+", 4) == 0) {
+        TIFF* tif = TIFFOpen(path.c_str(), "r");
+        if (!tif) {
+            return false;
+        }
+        uint32_t width = 0, height = 0;
+        TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+        TIFFClose(tif);
+        size = Size(width, height);
+        return true;
+    }
+#endif
+
+    return false;
+}
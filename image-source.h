@@ -0,0 +1,122 @@
+#ifndef IMAGE_SOURCE_H
+#define IMAGE_SOURCE_H
+
+#include <opencv2/core/core.hpp>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// An image that can be read region by region in full-resolution coordinates.
+class ImageSource {
+public:
+    virtual ~ImageSource() {}
+
+    virtual cv::Size size() const = 0;
+
+    // Copy the pixels inside roi (clipped to the image) into out as CV_8UC3.
+    virtual void read(const cv::Rect& roi, cv::Mat& out) = 0;
+
+    // Whether the image is decoded lazily and should be viewed through a
+    // window smaller than the image.
+    virtual bool tiled() const { return false; }
+};
+
+// A fully decoded image, as returned by imread().
+class MatImageSource : public ImageSource {
+public:
+    MatImageSource(const cv::Mat& m);
+
+    cv::Size size() const;
+    void read(const cv::Rect& roi, cv::Mat& out);
+
+private:
+    cv::Mat mat;
+};
+
+// LRU cache of decoded tiles, bounded by the number of pixel bytes it holds.
+class TileCache {
+public:
+    TileCache(size_t budget);
+
+    // Returns NULL if the tile is not cached.
+    const cv::Mat* get(int tx, int ty);
+    const cv::Mat& put(int tx, int ty, const cv::Mat& tile);
+
+private:
+    typedef std::pair<long long, cv::Mat> Entry;
+
+    void evict();
+
+    size_t budget;
+    size_t used;
+    std::list<Entry> lru;
+    std::unordered_map<long long, std::list<Entry>::iterator> index;
+};
+
+// An image split into fixed-size tiles which are decoded only when a read
+// touches them.
+class TiledImageSource : public ImageSource {
+public:
+    TiledImageSource(size_t cacheBudget);
+
+    cv::Size size() const;
+    void read(const cv::Rect& roi, cv::Mat& out);
+    bool tiled() const { return true; }
+
+protected:
+    // Decode tile (tx, ty) as CV_8UC3, cropped to the image border.
+    virtual bool loadTile(int tx, int ty, cv::Mat& tile) = 0;
+
+    cv::Size imageSize;
+    cv::Size tileSize;
+
+private:
+    TileCache cache;
+};
+
+// A pre-split tile pyramid on disk. The directory holds a 'tiles.txt'
+// with "width height tile_width tile_height extension" and the full
+// resolution level as '0/<row>_<col>.<extension>'. Lower levels, if any,
+// are not used.
+class TileDirImageSource : public TiledImageSource {
+public:
+    TileDirImageSource(const std::string& dir, size_t cacheBudget);
+
+    bool open();
+
+protected:
+    bool loadTile(int tx, int ty, cv::Mat& tile);
+
+private:
+    std::string dir;
+    std::string extension;
+};
+
+#ifdef HAVE_LIBTIFF
+typedef struct tiff TIFF;
+
+// A tiled TIFF read one tile at a time through libtiff.
+class TiffImageSource : public TiledImageSource {
+public:
+    TiffImageSource(const std::string& path, size_t cacheBudget);
+    ~TiffImageSource();
+
+    // Fails if the file is not a tiled TIFF.
+    bool open();
+
+protected:
+    bool loadTile(int tx, int ty, cv::Mat& tile);
+
+private:
+    std::string path;
+    TIFF* tif;
+};
+#endif
+
+// Get the dimensions of an image from its header, without decoding any
+// pixels. Knows tile directories, PNG, JPEG, BMP and, with libtiff, TIFF.
+// JPEG sizes follow the Exif orientation, as imread() does.
+bool readImageSize(const std::string& path, cv::Size& size);
+
+#endif
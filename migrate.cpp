@@ -0,0 +1,186 @@
+#include "migrate.h"
+#include "image-source.h"
+#include "path.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+using namespace cv;
+using namespace std;
+
+// A box file found in the box directory
+struct BoxFile {
+    Size size;
+    string path;
+    time_t mtime;
+};
+
+// Box files by '<box dir>/<image base name>', across all sizes
+typedef map<string, vector<BoxFile> > BoxFileIndex;
+
+// Splits '<base>_<cols>x<rows><extension>'
+static bool parseBoxFileName(const string& file, const string& extension,
+                             string& base, Size& size) {
+    if (file.size() <= extension.size() ||
+        file.compare(file.size() - extension.size(), extension.size(), extension) != 0) {
+        return false;
+    }
+    string::size_type sepPos = file.rfind('_', file.size() - extension.size());
+    if (sepPos == string::npos) {
+        return false;
+    }
+    const char* p = file.data() + sepPos + 1;
+    const char* last = file.data() + file.size() - extension.size();
+    from_chars_result r = from_chars(p, last, size.width);
+    if (r.ec != errc() || r.ptr == last || *r.ptr != 'x') {
+        return false;
+    }
+    r = from_chars(r.ptr + 1, last, size.height);
+    if (r.ec != errc() || r.ptr != last || size.width <= 0 || size.height <= 0) {
+        return false;
+    }
+    base = file.substr(0, sepPos);
+    return true;
+}
+
+// Directory of the box files of an image, and the image base name
+static void splitImageName(const string& name, const string& boxDir, string& dir, string& base) {
+    dir = boxDir;
+    base = name;
+    string::size_type lastSepPos = name.rfind(PATH_SEPARATOR);
+    if (lastSepPos != string::npos) {
+        dir += PATH_SEPARATOR + name.substr(0, lastSepPos);
+        base = name.substr(lastSepPos + 1);
+    }
+}
+
+static void indexBoxDir(const string& dir, const string& extension, BoxFileIndex& index) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        string file = entry->d_name, base;
+        BoxFile boxFile;
+        if (!parseBoxFileName(file, extension, base, boxFile.size)) {
+            continue;
+        }
+        struct stat st;
+        boxFile.path = dir + PATH_SEPARATOR + file;
+        if (stat(boxFile.path.c_str(), &st) != 0) {
+            continue;
+        }
+        boxFile.mtime = st.st_mtime;
+        index[dir + PATH_SEPARATOR + base].push_back(boxFile);
+    }
+    closedir(d);
+}
+
+// Scale the edges rather than the size, so adjacent boxes stay adjacent
+static Rect scaleRect(const Rect& rect, const Size& from, const Size& to) {
+    double sx = (double)to.width / from.width, sy = (double)to.height / from.height;
+    int x0 = lround(rect.x * sx), x1 = lround((rect.x + rect.width) * sx);
+    int y0 = lround(rect.y * sy), y1 = lround((rect.y + rect.height) * sy);
+    return Rect(x0, y0, max(1, x1 - x0), max(1, y1 - y0));
+}
+
+static bool migrateImage(const string& name, const string& workDir, const string& boxDir,
+                         BoxFormat format, const BoxFileIndex& index, ostream& log) {
+    string dir, base;
+    splitImageName(name, boxDir, dir, base);
+    BoxFileIndex::const_iterator files = index.find(dir + PATH_SEPARATOR + base);
+    if (files == index.end()) {
+        return true;
+    }
+
+    Size size;
+    if (!readImageSize(workDir + PATH_SEPARATOR + name, size)) {
+        log << "Reading the header of image '" << name << "' [FAIL]" << endl;
+        return false;
+    }
+
+    // Pick the most recently saved box file of another size, unless there
+    // is one for the current size already
+    const BoxFile* stale = NULL;
+    for (vector<BoxFile>::const_iterator it = files->second.begin(); it != files->second.end(); it++) {
+        if (it->size == size) {
+            return true;
+        }
+        if (!stale || it->mtime > stale->mtime) {
+            stale = &(*it);
+        }
+    }
+
+    string boxfile = dir + PATH_SEPARATOR + base + "_" +
+        to_string(size.width) + "x" + to_string(size.height) + boxFileExtension(format);
+    log << "Migrating the box of image '" << name << "' " << stale->size.width << "x"
+        << stale->size.height << " -> " << size.width << "x" << size.height << " ";
+
+    vector<Box> boxes;
+    if (!readBoxFile(stale->path, format, boxes)) {
+        log << "[FAIL]" << endl;
+        return false;
+    }
+    for (vector<Box>::iterator it = boxes.begin(); it != boxes.end(); it++) {
+        it->rect = scaleRect(it->rect, stale->size, size);
+    }
+    if (!writeBoxFile(boxfile, format, boxes)) {
+        log << "[FAIL]" << endl;
+        return false;
+    }
+    log << "[DONE] " << boxes.size() << " boxes" << endl;
+    return true;
+}
+
+int migrateBoxes(const vector<string>& images, const string& workDir,
+                 const string& boxDir, BoxFormat format) {
+    // Scan every box directory once, up front, the workers only look up
+    string extension = boxFileExtension(format);
+    set<string> dirs;
+    for (vector<string>::const_iterator it = images.begin(); it != images.end(); it++) {
+        string dir, base;
+        splitImageName(*it, boxDir, dir, base);
+        dirs.insert(dir);
+    }
+    BoxFileIndex index;
+    for (set<string>::iterator it = dirs.begin(); it != dirs.end(); it++) {
+        indexBoxDir(*it, extension, index);
+    }
+
+    atomic<size_t> next(0);
+    atomic<int> failed(0);
+    mutex logMutex;
+
+    unsigned int n = max(1u, thread::hardware_concurrency());
+    vector<thread> workers;
+    for (unsigned int i = 0; i < n; i++) {
+        workers.push_back(thread([&]() {
+            size_t idx;
+            while ((idx = next++) < images.size()) {
+                ostringstream log;
+                if (!migrateImage(images[idx], workDir, boxDir, format, index, log)) {
+                    failed++;
+                }
+                if (!log.str().empty()) {
+                    lock_guard<mutex> lock(logMutex);
+                    cout << log.str();
+                }
+            }
+        }));
+    }
+    for (vector<thread>::iterator it = workers.begin(); it != workers.end(); it++) {
+        it->join();
+    }
+    return failed;
+}
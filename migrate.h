@@ -0,0 +1,16 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include "box-codec.h"
+#include <string>
+#include <vector>
+
+// For every image, find box files saved for another image size, scale
+// their boxes to the size in the image header and write them under the
+// current size. Stale files are left in place, current ones are never
+// overwritten. Box directories are scanned once, then images are
+// processed in parallel. Returns the number of images that failed.
+int migrateBoxes(const std::vector<std::string>& images, const std::string& workDir,
+                 const std::string& boxDir, BoxFormat format);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef PATH_H
+#define PATH_H
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+#define PATH_SEPARATOR '\\'
+#else
+#define PATH_SEPARATOR '/'
+#endif
+
+#endif
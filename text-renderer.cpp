@@ -0,0 +1,64 @@
+#include "text-renderer.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <map>
+#include <tuple>
+
+using namespace cv;
+using namespace std;
+
+// Strings kept per renderer, the cache is dropped when it grows past this
+static const size_t MAX_CACHED_STRINGS = 256;
+
+TextRenderer::TextRenderer(int fontFace, double fontScale, int thickness):
+    fontFace(fontFace), fontScale(fontScale), thickness(thickness) {}
+
+Size TextRenderer::measure(const string& text, int* baseline) {
+    const Rendered& r = render(text);
+    if (baseline) {
+        *baseline = r.baseline;
+    }
+    return r.size;
+}
+
+Rect TextRenderer::draw(Mat& dst, const string& text, Point org, const Scalar& color) {
+    const Rendered& r = render(text);
+    Rect area(org - r.origin, r.mask.size());
+    Rect clipped = area & Rect(0, 0, dst.cols, dst.rows);
+    if (clipped.area() > 0) {
+        dst(clipped).setTo(color, r.mask(clipped - area.tl()));
+    }
+    return clipped;
+}
+
+TextRenderer& TextRenderer::get(int fontFace, double fontScale, int thickness) {
+    static map<tuple<int, double, int>, TextRenderer> renderers;
+    tuple<int, double, int> key(fontFace, fontScale, thickness);
+    map<tuple<int, double, int>, TextRenderer>::iterator it = renderers.find(key);
+    if (it == renderers.end()) {
+        it = renderers.insert(make_pair(key, TextRenderer(fontFace, fontScale, thickness))).first;
+    }
+    return it->second;
+}
+
+const TextRenderer::Rendered& TextRenderer::render(const string& text) {
+    unordered_map<string, Rendered>::iterator it = cache.find(text);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    if (cache.size() >= MAX_CACHED_STRINGS) {
+        cache.clear();
+    }
+
+    Rendered r;
+    r.baseline = 0;
+    r.size = getTextSize(text, fontFace, fontScale, thickness, &r.baseline);
+
+    // Thick strokes and tall glyphs such as brackets spill outside the
+    // text box, leave room for them
+    int pad = thickness + 2, vpad = pad + r.size.height / 2;
+    r.origin = Point(pad, r.size.height + vpad);
+    r.mask = Mat(r.size.height + r.baseline + 2 * vpad, r.size.width + 2 * pad, CV_8UC1, Scalar(0));
+    putText(r.mask, text, r.origin, fontFace, fontScale, Scalar(255), thickness, 8);
+
+    return cache.insert(make_pair(text, r)).first->second;
+}
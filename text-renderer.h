@@ -0,0 +1,40 @@
+#ifndef TEXT_RENDERER_H
+#define TEXT_RENDERER_H
+
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <unordered_map>
+
+// Renders strings in one font, scale and thickness. Each string is
+// rasterized once into a mask and then blitted, so redrawing the same
+// label costs a masked copy instead of a putText().
+class TextRenderer {
+public:
+    TextRenderer(int fontFace, double fontScale, int thickness);
+
+    // Same as getTextSize()
+    cv::Size measure(const std::string& text, int* baseline = NULL);
+
+    // Same as putText() with lineType 8, returns the area it may touch
+    cv::Rect draw(cv::Mat& dst, const std::string& text, cv::Point org, const cv::Scalar& color);
+
+    // The renderer shared by everyone drawing in this font
+    static TextRenderer& get(int fontFace, double fontScale, int thickness);
+
+private:
+    struct Rendered {
+        cv::Mat mask;
+        cv::Point origin;
+        cv::Size size;
+        int baseline;
+    };
+
+    const Rendered& render(const std::string& text);
+
+    int fontFace;
+    double fontScale;
+    int thickness;
+    std::unordered_map<std::string, Rendered> cache;
+};
+
+#endif